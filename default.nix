@@ -1,16 +1,20 @@
 { pkgs ? ((import <nixpkgs> { })) }:
 with pkgs;
 let
-  version = "c740fccc9dd0913908c0632c10f8c6d10b2b1ca4";
+  # 0.14 is the first release with the pixman renderer, WLR_RENDERER and
+  # DRM format textures, and the last with wlr_backend_get_renderer.
+  version = "0.14.1";
 
-  wlroots-git = wlroots.overrideAttrs (old: {
+  wlroots-0_14 = wlroots.overrideAttrs (old: {
     version = version;
-    src = fetchFromGitHub {
-      owner = "swaywm";
+    src = fetchFromGitLab {
+      domain = "gitlab.freedesktop.org";
+      owner = "wlroots";
       repo = "wlroots";
       rev = version;
-      sha256 = "0667qvrfp338cmswaykvga487bql0xhisndwcq50n7xcjlib1lxj";
+      sha256 = "1sshp3lvlkl1i670kxhwsb4xzxl8raz6769kqvgmxzcb63ns9ay1";
     };
+    patches = [ ];
     buildInputs = old.buildInputs ++ [ libuuid xorg.xcbutilrenderutil xwayland ];
   });
 
@@ -26,5 +30,5 @@ in stdenv.mkDerivation rec {
     cp main $out/bin/wm
   '';
 
-  buildInputs = [ libGL libinput libxkbcommon pixman wayland wlroots-git x11 ];
+  buildInputs = [ libGL libdrm libinput libxkbcommon pixman wayland wlroots-0_14 x11 ];
 }
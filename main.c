@@ -1,14 +1,25 @@
 #define _XOPEN_SOURCE 700
 #include <X11/Xlib.h>
 #include <assert.h>
+#include <drm_fourcc.h>
+#include <errno.h>
 #include <execinfo.h>
 #include <libinput.h>
 #include <linux/input-event-codes.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <wayland-client.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
 #include <wlr/backend/libinput.h>
+#include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_cursor.h>
@@ -30,7 +41,28 @@
 #include <wlr/xwayland.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "xdg-shell-client-protocol.h"
+
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK 0x40000000
+#endif
+
 enum { XDGShell, X11Managed, X11Unmanaged };
+enum { NoBuffer, ShmBuffer, DmabufBuffer };
+enum {
+  BenchTiles = 8,
+  BenchSubsurfaces = 2,
+  BenchSubsurfaceSize = 256,
+  BenchWarmup = 10
+};
+enum {
+  Started,
+  BackendStarted,
+  OutputCommitted,
+  FirstFrame,
+  XwaylandReady,
+  Milestones
+};
 
 typedef struct Monitor Monitor;
 typedef struct {
@@ -45,11 +77,36 @@ typedef struct {
   struct wl_listener fullscreen;
   struct wl_listener activate;  // xwayland only
   struct wl_listener configure; // xwayland only
+  struct wl_listener commit;
+  struct wl_listener new_subsurface; // xdg only
+  struct wl_listener new_popup;      // xdg only
+  struct wl_list children;           // Child.link
   struct wlr_box geom;
   unsigned int type;
   unsigned int tag;
+
+  // Profile, the *_s fields hold the last full second
+  unsigned int commits, commits_s;
+  uint64_t uploaded, uploaded_s; // bytes copied from shm into textures
+  int64_t render_ns, render_ns_s;
+  int width, height, buffer;     // last committed buffer
+  struct wlr_client_buffer *imported; // to tell a fresh import from an update
 } Client;
 
+// A subsurface or popup surface, its commits count toward its Client
+typedef struct {
+  struct wl_list link;
+  Client *client; // NULL once the Client is gone
+  struct wlr_surface *surface;
+  struct wlr_xdg_surface *xdg; // popups only
+  struct wlr_client_buffer *imported;
+  struct wl_listener commit;
+  struct wl_listener new_subsurface;
+  struct wl_listener new_popup;   // popups only
+  struct wl_listener xdg_destroy; // popups only
+  struct wl_listener destroy;
+} Child;
+
 
 typedef struct {
   struct wl_list link;
@@ -58,8 +115,25 @@ typedef struct {
   struct wl_listener modifiers;
   struct wl_listener key;
   struct wl_listener destroy;
+
+  struct xkb_context *context; // created on the event loop
+  struct xkb_keymap *keymap;
+  int compiling; // keymap job outstanding, free on completion
 } Input;
 
+typedef struct {
+  struct wl_surface *surface;
+  struct wl_buffer *buffer;
+} BenchSurface;
+
+// Blocking work run on a worker thread, done then runs on the event loop
+typedef struct Job {
+  struct Job *next;
+  void (*work)(void *data);
+  void (*done)(void *data);
+  void *data;
+} Job;
+
 struct render_data {
   struct timespec *when;
   int x, y; // layout-relative
@@ -69,7 +143,9 @@ static struct wl_list clients; // tiling order
 static struct wl_list independents;
 static struct wlr_xcursor_manager *cm;
 
+static struct wl_display *display;
 static struct wlr_renderer *renderer;
+static struct wlr_compositor *compositor;
 static struct wlr_xdg_shell *xdg_shell;
 static struct wlr_xwayland *xwayland;
 static struct wlr_output_layout *ol;
@@ -87,6 +163,60 @@ static int tag;
 static Client *sclient;
 static Client *fsclient;
 
+// Focus follows the pointer only once it rests for focus_delay ms, or has
+// stayed over the same client for focus_dwell ms while still moving.
+static struct wl_event_source *focus_timer;
+static Client *pfocus;
+static uint32_t pfocus_since;
+static int focus_delay = 30;
+static const uint32_t focus_dwell = 150;
+
+static struct wl_event_source *stats_timer;
+static unsigned int activations; // xdg activation configures this second
+
+// Frames that arrived more than half a refresh period late
+static int lowlatency;
+static struct timespec last_frame;
+static unsigned int misses;
+static unsigned long total_frames, total_misses;
+
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+static Job *jobs, **jobs_tail = &jobs;
+static Job *jobs_done;
+static int jobs_fd;
+
+// Jobs must not read the environment while it can change, so everything they
+// would getenv is resolved on the event loop and the environment is final
+// before the first job is submitted
+static struct xkb_rule_names xkb_names;
+
+// Event loop dispatch batches that ran longer than stall_limit ns
+static const int64_t stall_limit = 1000000;
+static unsigned int stalls;
+static int64_t worst_stall;
+
+// Start Xwayland once the first frame is out instead of on first X11 client
+static int prewarm;
+
+static const char *milestones[] = {"main", "backend started",
+                                   "first output commit", "first frame",
+                                   "xwayland ready"};
+static struct timespec timeline[Milestones];
+
+// -b: run headless against a fixed scene from a forked client and time the
+// frames on_output_frame composites once all of it is mapped
+static int bench_frames, bench_done, bench_warmup, bench_failed;
+static pid_t bench_pid;
+static int64_t bench_total, bench_worst;
+static int quit;
+
+// The forked benchmark client's globals
+static struct wl_compositor *bench_compositor;
+static struct wl_subcompositor *bench_subcompositor;
+static struct wl_shm *bench_shm;
+static struct xdg_wm_base *bench_wm;
+
 #define MAX(A, B) ((A) > (B) ? (A) : (B))
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
 #define LENGTH(X) (sizeof X / sizeof X[0])
@@ -104,6 +234,36 @@ static Client *fsclient;
   T *it = NULL;                                                                \
   wl_list_for_each_reverse(it, &L, link)
 
+static inline int64_t timespec_ns(const struct timespec *t) {
+  return (int64_t)t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+// Log when a startup milestone is first reached, relative to main() and
+// to the latest milestone before it. Outputs can be committed from inside
+// wlr_backend_start, so milestones do not always arrive in enum order.
+void milestone(int m) {
+  if (timeline[m].tv_sec) {
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &timeline[m]);
+  if (m == Started) {
+    return;
+  }
+
+  int64_t at = timespec_ns(&timeline[m]);
+  int prev = Started;
+  for (int i = Started + 1; i < Milestones; i++) {
+    int64_t t = timespec_ns(&timeline[i]);
+    if (i != m && timeline[i].tv_sec && t <= at &&
+        t >= timespec_ns(&timeline[prev])) {
+      prev = i;
+    }
+  }
+  log("startup: %s at %.1f ms (+%.1f ms after %s)", milestones[m],
+      (at - timespec_ns(&timeline[Started])) / 1e6,
+      (at - timespec_ns(&timeline[prev])) / 1e6, milestones[prev]);
+}
+
 #define CASE(K, COND, C) \
   case K:                \
     if (COND) { C; }     \
@@ -136,6 +296,7 @@ Client *xytoindependent(double x, double y) {
 
 static inline void client_activate_surface(struct wlr_surface *s,
                                            int activated) {
+  static uint32_t counted;
   if (wlr_surface_is_xwayland_surface(s)) {
     wlr_xwayland_surface_activate(wlr_xwayland_surface_from_wlr_surface(s),
                                   activated);
@@ -144,7 +305,12 @@ static inline void client_activate_surface(struct wlr_surface *s,
   if (wlr_surface_is_xdg_surface(s)) {
     struct wlr_xdg_surface *sur = wlr_xdg_surface_from_wlr_surface(s);
     if (NULL != sur) {
-      wlr_xdg_toplevel_set_activated(sur, activated);
+      // 0 when nothing changed, the pending serial when merged into one
+      uint32_t serial = wlr_xdg_toplevel_set_activated(sur, activated);
+      if (serial && serial != counted) {
+        counted = serial;
+        activations++;
+      }
     };
   };
 }
@@ -167,6 +333,21 @@ client_surface_at(Client *c, double cx, double cy, double *sx, double *sy) {
                                       sy);
 }
 
+void count_surface(struct wlr_surface *s, int sx, int sy, void *data) {
+  (*(unsigned int *)data)++;
+}
+
+unsigned int client_subsurfaces(Client *c) {
+  unsigned int n = 0;
+  if (c->type == XDGShell) {
+    wlr_xdg_surface_for_each_surface(c->surface.xdg, count_surface, &n);
+  } else {
+    wlr_surface_for_each_surface(c->surface.xwayland->surface, count_surface,
+                                 &n);
+  }
+  return n ? n - 1 : 0;
+}
+
 void set_geometry(Client *c, int x, int y, int w, int h) {
   c->geom = (struct wlr_box){.x = x, .y = y, .width = w, .height = h};
   if (c->type == XDGShell) {
@@ -235,6 +416,7 @@ void arrange() {
 }
 
 void focus(Client *c) {
+  pfocus = NULL;
   struct wlr_surface *old = seat->keyboard_state.focused_surface;
   sclient = c;
   struct wlr_surface *new = client_surface(c);
@@ -253,7 +435,11 @@ void focus(Client *c) {
   }
 
   struct wlr_keyboard *kb = wlr_seat_get_keyboard(seat);
-  wlr_seat_keyboard_notify_enter(seat, new, kb->keycodes, kb->num_keycodes, &kb->modifiers);
+  if (kb) {
+    wlr_seat_keyboard_notify_enter(seat, new, kb->keycodes, kb->num_keycodes, &kb->modifiers);
+  } else {
+    wlr_seat_keyboard_notify_enter(seat, new, NULL, 0, NULL);
+  }
 
   client_activate_surface(new, 1);
 }
@@ -262,6 +448,195 @@ void focus_under_cursor() {
 	focus(xytoclient(cursor->x, cursor->y));
 }
 
+// Hover focus: commit now if the dwell is over, otherwise (re)arm the timer
+void focus_defer(Client *c, uint32_t time) {
+  if (c != pfocus) {
+    pfocus = c;
+    pfocus_since = time;
+  }
+  if (focus_delay <= 0 || time - pfocus_since >= focus_dwell) {
+    focus(c);
+    return;
+  }
+  wl_event_source_timer_update(focus_timer, focus_delay);
+}
+
+int on_focus_timer(void *data) {
+  if (pfocus) {
+    focus(pfocus);
+  }
+  return 0;
+}
+
+void profile_roll(Client *c) {
+  c->commits_s = c->commits;
+  c->uploaded_s = c->uploaded;
+  c->render_ns_s = c->render_ns;
+  c->commits = 0;
+  c->uploaded = 0;
+  c->render_ns = 0;
+}
+
+int by_render(const void *a, const void *b) {
+  const Client *x = *(Client *const *)a, *y = *(Client *const *)b;
+  if (x->render_ns_s != y->render_ns_s) {
+    return x->render_ns_s < y->render_ns_s ? 1 : -1;
+  }
+  return (x->uploaded_s < y->uploaded_s) - (x->uploaded_s > y->uploaded_s);
+}
+
+int by_upload(const void *a, const void *b) {
+  const Client *x = *(Client *const *)a, *y = *(Client *const *)b;
+  if (x->uploaded_s != y->uploaded_s) {
+    return x->uploaded_s < y->uploaded_s ? 1 : -1;
+  }
+  return (x->render_ns_s < y->render_ns_s) - (x->render_ns_s > y->render_ns_s);
+}
+
+// Log every mapped client's last second, most expensive first: SIGRTMIN+1
+// sorts by render time, SIGRTMIN+2 by bytes uploaded. SIGUSR1 belongs to
+// wlroots, which uses it to learn that Xwayland is ready.
+int on_profile(int sig, void *data) {
+  int by_time = sig == SIGRTMIN + 1;
+  static const char *buffers[] = {"-", "shm", "dmabuf"};
+  int n = wl_list_length(&clients) + wl_list_length(&independents);
+  Client **v = calloc(MAX(n, 1), sizeof(*v));
+
+  int i = 0;
+  Client *c;
+  wl_list_for_each(c, &clients, link) { v[i++] = c; }
+  wl_list_for_each(c, &independents, link) { v[i++] = c; }
+  qsort(v, n, sizeof(*v), by_time ? by_render : by_upload);
+
+  log("profile: %d clients, by %s", n, by_time ? "render" : "upload");
+  for (i = 0; i < n; i++) {
+    const char *id = client_get_appid(v[i]);
+    log("profile: %-24s %4u commits/s %5dx%-5d %-6s %10.1f KiB/s "
+        "%3u subsurfaces %7.3f ms/s",
+        id ? id : "?", v[i]->commits_s, v[i]->width, v[i]->height,
+        buffers[v[i]->buffer], v[i]->uploaded_s / 1024.0,
+        client_subsurfaces(v[i]), v[i]->render_ns_s / 1e6);
+  }
+  free(v);
+  return 0;
+}
+
+int on_stats_timer(void *data) {
+  if (activations) {
+    log("focus: %u xdg activation configures/s", activations);
+  }
+  if (misses) {
+    log("frame: %u deadline misses/s, %lu of %lu frames (lowlatency %s)",
+        misses, total_misses, total_frames, lowlatency ? "on" : "off");
+  }
+  if (stalls) {
+    log("event loop: %u dispatch batches over 1 ms/s, worst batch %.2f ms "
+        "(per batch of ready sources, not per callback)",
+        stalls, worst_stall / 1e6);
+  }
+  Client *c;
+  wl_list_for_each(c, &clients, link) { profile_roll(c); }
+  wl_list_for_each(c, &independents, link) { profile_roll(c); }
+
+  activations = 0;
+  misses = 0;
+  stalls = 0;
+  worst_stall = 0;
+  wl_event_source_timer_update(stats_timer, 1000);
+  return 0;
+}
+
+void *worker(void *unused) {
+  for (;;) {
+    pthread_mutex_lock(&jobs_lock);
+    while (!jobs) {
+      pthread_cond_wait(&jobs_cond, &jobs_lock);
+    }
+    Job *j = jobs;
+    if (!(jobs = j->next)) {
+      jobs_tail = &jobs;
+    }
+    pthread_mutex_unlock(&jobs_lock);
+
+    j->work(j->data);
+
+    pthread_mutex_lock(&jobs_lock);
+    j->next = jobs_done;
+    jobs_done = j;
+    pthread_mutex_unlock(&jobs_lock);
+
+    uint64_t one = 1;
+    if (write(jobs_fd, &one, sizeof one) != sizeof one) {
+      log("worker: can't signal completion: %s", strerror(errno));
+    }
+  }
+  return NULL;
+}
+
+void submit(void (*work)(void *), void (*done)(void *), void *data) {
+  Job *j = calloc(1, sizeof(*j));
+  j->work = work;
+  j->done = done;
+  j->data = data;
+
+  pthread_mutex_lock(&jobs_lock);
+  *jobs_tail = j;
+  jobs_tail = &j->next;
+  pthread_cond_signal(&jobs_cond);
+  pthread_mutex_unlock(&jobs_lock);
+}
+
+int on_jobs_done(int fd, uint32_t mask, void *data) {
+  uint64_t n;
+  if (read(fd, &n, sizeof n) != sizeof n) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&jobs_lock);
+  Job *j = jobs_done;
+  jobs_done = NULL;
+  pthread_mutex_unlock(&jobs_lock);
+
+  while (j) {
+    Job *next = j->next;
+    if (j->done) {
+      j->done(j->data);
+    }
+    free(j);
+    j = next;
+  }
+  return 0;
+}
+
+// Workers block every signal so they are all seen by the event loop, and
+// never inherit realtime scheduling.
+void workers_init(struct wl_event_loop *loop, int n) {
+  jobs_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  assert(jobs_fd >= 0);
+  wl_event_loop_add_fd(loop, jobs_fd, WL_EVENT_READABLE, on_jobs_done, NULL);
+
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+  pthread_attr_setschedparam(&attr, &(struct sched_param){0});
+  // Jobs are shallow, and an 8 MiB default stack each would be locked by -r
+  pthread_attr_setstacksize(&attr, 512 << 10);
+
+  for (int i = 0; i < n; i++) {
+    pthread_t t;
+    assert(pthread_create(&t, &attr, worker, NULL) == 0);
+  }
+
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
 void on_cursor_axis(struct wl_listener *listener, void *data) {
   struct wlr_event_pointer_axis *e = data;
   wlr_seat_pointer_notify_axis(seat, e->time_msec, e->orientation, e->delta,
@@ -270,6 +645,10 @@ void on_cursor_axis(struct wl_listener *listener, void *data) {
 
 void on_cursor_button(struct wl_listener *listener, void *data) {
   struct wlr_event_pointer_button *e = data;
+  // A click lands on the window under the pointer, so it gets focus now
+  if (pfocus && e->state == WLR_BUTTON_PRESSED) {
+    focus(pfocus);
+  }
   wlr_seat_pointer_notify_button(seat, e->time_msec, e->button, e->state);
 }
 
@@ -279,6 +658,7 @@ void on_output_destroy(struct wl_listener *listener, void *data) {
   wl_list_remove(&mon_destroy.link);
   wl_list_remove(&mon_frame.link);
   mo = NULL;
+  last_frame = (struct timespec){0};
 }
 
 void render(struct wlr_surface *surface, int sx, int sy, void *data) {
@@ -294,27 +674,72 @@ void render(struct wlr_surface *surface, int sx, int sy, void *data) {
 }
 
 void submit_client(Client *it, struct timespec *time) {
+    int unmanaged = it->type == X11Unmanaged;
     struct render_data *d = &(struct render_data){
         .when = time,
-        .x = it->geom.x,
-        .y = it->geom.y,
+        .x = unmanaged ? it->surface.xwayland->x : it->geom.x,
+        .y = unmanaged ? it->surface.xwayland->y : it->geom.y,
     };
 
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     if (it->type == XDGShell) {
       wlr_xdg_surface_for_each_surface(it->surface.xdg, render, d);
     } else {
       wlr_surface_for_each_surface(it->surface.xwayland->surface, render, d);
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    it->render_ns += timespec_ns(&end) - timespec_ns(&start);
 }
 
-void on_output_frame(struct wl_listener *listener, void *data) {
-  if (!wlr_output_attach_render(mo, NULL)) {
+static inline const char *renderer_name() {
+  return wlr_renderer_is_pixman(renderer) ? "pixman" : "gles2";
+}
+
+void bench_frame(const struct timespec *start) {
+  if (wl_list_length(&clients) < BenchTiles + 1 || !fsclient ||
+      bench_warmup++ < BenchWarmup) {
     return;
   }
 
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  int64_t took = timespec_ns(&end) - timespec_ns(start);
+  bench_total += took;
+  bench_worst = MAX(bench_worst, took);
+  if (++bench_done < bench_frames) {
+    return;
+  }
+
+  log("bench: %s: %d frames, %d tiled clients with %d subsurfaces, "
+      "1 fullscreen: %.3f ms/frame, worst %.3f ms",
+      renderer_name(), bench_done, BenchTiles, BenchSubsurfaces,
+      bench_total / 1e6 / bench_done, bench_worst / 1e6);
+  kill(bench_pid, SIGTERM);
+  quit = 1;
+}
+
+void xwayland_start(int lazy);
+
+void on_output_frame(struct wl_listener *listener, void *data) {
   struct timespec now;
   clock_gettime(CLOCK_MONOTONIC, &now);
 
+  if (!wlr_output_attach_render(mo, NULL)) {
+    return;
+  }
+
+  if (last_frame.tv_sec && mo->refresh > 0) {
+    int64_t period = 1000000000000LL / mo->refresh;
+    if (timespec_ns(&now) - timespec_ns(&last_frame) > period * 3 / 2) {
+      misses++;
+      total_misses++;
+    }
+  }
+  last_frame = now;
+  total_frames++;
+
   wlr_renderer_begin(renderer, mw, mh);
   wlr_renderer_clear(renderer, (float[]){0.0, 0.0, 0.0, 1.0});
 
@@ -329,16 +754,36 @@ void on_output_frame(struct wl_listener *listener, void *data) {
 
   Client *in;
   wl_list_for_each(in, &independents, link) {
-      wlr_surface_for_each_surface(in->surface.xwayland->surface, render,
-                                   &(struct render_data){
-                                       .when = &now,
-                                       .x = in->surface.xwayland->x,
-                                       .y = in->surface.xwayland->y,
-                                   });
+    submit_client(in, &now);
+  }
+
+  if (bench_frames > 0) {
+    // Reading a pixel back waits for the GPU, so both renderers are timed
+    // to completion rather than to submission
+    uint32_t px;
+    wlr_renderer_read_pixels(renderer, DRM_FORMAT_ARGB8888, NULL, 4, 1, 1, 0,
+                             0, 0, 0, &px);
   }
 
   wlr_renderer_end(renderer);
-  wlr_output_commit(mo);
+  if (wlr_output_commit(mo)) {
+    milestone(FirstFrame);
+  }
+
+  if (bench_frames > 0) {
+    bench_frame(&now);
+  }
+
+  if (prewarm && !xwayland) {
+    xwayland_start(0);
+  }
+}
+
+void cursor_theme_load(void *data) { wlr_xcursor_manager_load(data, 1); }
+
+void cursor_theme_loaded(void *data) {
+  cm = data;
+  wlr_xcursor_manager_set_cursor_image(cm, "left_ptr", cursor);
 }
 
 void on_backend_new_output(struct wl_listener *listener, void *data) {
@@ -353,25 +798,166 @@ void on_backend_new_output(struct wl_listener *listener, void *data) {
       break;
     }
   }
-  wlr_output_enable_adaptive_sync(mo, 1);
+  // Outputs without modes (headless, nested) get the layout size
+  if (wl_list_empty(&mo->modes)) {
+    wlr_output_set_custom_mode(mo, mw, mh, 239761);
+  } else {
+    wlr_output_enable_adaptive_sync(mo, 1);
+  }
 
   wl_signal_add(&mo->events.frame, &mon_frame);
   wl_signal_add(&mo->events.destroy, &mon_destroy);
   wlr_output_layout_add_auto(ol, mo);
 
-  wlr_xcursor_manager_load(cm, 1);
-  wlr_xcursor_manager_set_cursor_image(cm, "left_ptr", cursor);
+  if (cm) {
+    wlr_xcursor_manager_set_cursor_image(cm, "left_ptr", cursor);
+  }
 
   wlr_output_enable(mo, 1);
   if (wlr_output_commit(mo)) {
+    milestone(OutputCommitted);
     arrange();
   }
 }
 
+// Count a commit on any of c's surfaces, buffer size and type are the root's
+static inline int shm_bpp(uint32_t format) {
+  switch (format) {
+  case WL_SHM_FORMAT_RGB565:
+  case WL_SHM_FORMAT_BGR565:
+    return 2;
+  case WL_SHM_FORMAT_RGB888:
+  case WL_SHM_FORMAT_BGR888:
+    return 3;
+  default:
+    return 4;
+  }
+}
+
+void profile_commit(Client *c, struct wlr_surface *s,
+                    struct wlr_client_buffer **imported, int root) {
+  c->commits++;
+  if (root) {
+    c->width = s->current.buffer_width;
+    c->height = s->current.buffer_height;
+  }
+  // wlroots imports a new client buffer, uploading all of it, when there was
+  // none or the size or format changed, and updates it in place otherwise
+  struct wlr_client_buffer *last = *imported;
+  *imported = s->buffer;
+  if (!s->buffer || !s->buffer->resource) {
+    return;
+  }
+
+  struct wl_shm_buffer *shm = wl_shm_buffer_get(s->buffer->resource);
+  if (root) {
+    c->buffer = shm ? ShmBuffer : DmabufBuffer;
+  }
+  if (!shm) {
+    return;
+  }
+
+  if (s->buffer != last) {
+    c->uploaded += (uint64_t)wl_shm_buffer_get_stride(shm) *
+                   wl_shm_buffer_get_height(shm);
+    return;
+  }
+
+  // Otherwise only the damaged rectangles are copied into the texture
+  int n, bpp = shm_bpp(wl_shm_buffer_get_format(shm));
+  pixman_box32_t *r = pixman_region32_rectangles(&s->buffer_damage, &n);
+  for (int i = 0; i < n; i++) {
+    c->uploaded += (uint64_t)(r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1) * bpp;
+  }
+}
+
+void on_surface_commit(struct wl_listener *listener, void *data) {
+  Client *c = wl_container_of(listener, c, commit);
+  profile_commit(c, client_surface(c), &c->imported, 1);
+}
+
+void child_track(Client *c, struct wlr_surface *s, struct wlr_xdg_surface *xdg);
+
+void on_child_commit(struct wl_listener *listener, void *data) {
+  Child *ch = wl_container_of(listener, ch, commit);
+  if (ch->client) {
+    profile_commit(ch->client, ch->surface, &ch->imported, 0);
+  }
+}
+
+void on_child_new_subsurface(struct wl_listener *listener, void *data) {
+  Child *ch = wl_container_of(listener, ch, new_subsurface);
+  struct wlr_subsurface *sub = data;
+  if (ch->client) {
+    child_track(ch->client, sub->surface, NULL);
+  }
+}
+
+void on_child_new_popup(struct wl_listener *listener, void *data) {
+  Child *ch = wl_container_of(listener, ch, new_popup);
+  struct wlr_xdg_popup *popup = data;
+  if (ch->client) {
+    child_track(ch->client, popup->base->surface, popup->base);
+  }
+}
+
+void on_child_xdg_destroy(struct wl_listener *listener, void *data) {
+  Child *ch = wl_container_of(listener, ch, xdg_destroy);
+  wl_list_remove(&ch->new_popup.link);
+  wl_list_remove(&ch->xdg_destroy.link);
+  ch->xdg = NULL;
+}
+
+void on_child_destroy(struct wl_listener *listener, void *data) {
+  Child *ch = wl_container_of(listener, ch, destroy);
+  if (ch->xdg) {
+    on_child_xdg_destroy(&ch->xdg_destroy, NULL);
+  }
+  wl_list_remove(&ch->commit.link);
+  wl_list_remove(&ch->new_subsurface.link);
+  wl_list_remove(&ch->destroy.link);
+  wl_list_remove(&ch->link);
+  free(ch);
+}
+
+void child_track(Client *c, struct wlr_surface *s, struct wlr_xdg_surface *xdg) {
+  Child *ch = calloc(1, sizeof(*ch));
+  ch->client = c;
+  ch->surface = s;
+  ch->xdg = xdg;
+  ch->commit.notify = on_child_commit;
+  ch->new_subsurface.notify = on_child_new_subsurface;
+  ch->destroy.notify = on_child_destroy;
+  wl_signal_add(&s->events.commit, &ch->commit);
+  wl_signal_add(&s->events.new_subsurface, &ch->new_subsurface);
+  wl_signal_add(&s->events.destroy, &ch->destroy);
+  if (xdg) {
+    ch->new_popup.notify = on_child_new_popup;
+    ch->xdg_destroy.notify = on_child_xdg_destroy;
+    wl_signal_add(&xdg->events.new_popup, &ch->new_popup);
+    wl_signal_add(&xdg->events.destroy, &ch->xdg_destroy);
+  }
+  wl_list_insert(&c->children, &ch->link);
+}
+
+void on_client_new_subsurface(struct wl_listener *listener, void *data) {
+  Client *c = wl_container_of(listener, c, new_subsurface);
+  struct wlr_subsurface *sub = data;
+  child_track(c, sub->surface, NULL);
+}
+
+void on_client_new_popup(struct wl_listener *listener, void *data) {
+  Client *c = wl_container_of(listener, c, new_popup);
+  struct wlr_xdg_popup *popup = data;
+  child_track(c, popup->base->surface, popup->base);
+}
+
 // Ready to manage this surface
 void on_xdg_surface_map(struct wl_listener *listener, void *data) {
   //log("%s", "on_xdg_surface_map");
   Client *c = wl_container_of(listener, c, map);
+  c->commit.notify = on_surface_commit;
+  wl_signal_add(&client_surface(c)->events.commit, &c->commit);
   if (c->type == X11Unmanaged) {
     wl_list_insert(&independents, &c->link);
     return;
@@ -387,6 +973,10 @@ void on_xdg_surface_unmap(struct wl_listener *listener, void *data) {
   //log("%s", "on_xdg_surface_unmap");
   Client *c = wl_container_of(listener, c, unmap);
   int sel = sclient == c;
+  if (pfocus == c) {
+    pfocus = NULL;
+  }
+  wl_list_remove(&c->commit.link);
   wl_list_remove(&c->link);
   arrange();
   if (sel) {
@@ -404,6 +994,14 @@ void on_xdg_surface_destroy(struct wl_listener *listener, void *data) {
     wl_list_remove(&c->activate.link);
   } else if (c->type == XDGShell) {
     wl_list_remove(&c->fullscreen.link);
+    wl_list_remove(&c->new_subsurface.link);
+    wl_list_remove(&c->new_popup.link);
+  }
+  Child *ch, *tmp;
+  wl_list_for_each_safe(ch, tmp, &c->children, link) {
+    ch->client = NULL;
+    wl_list_remove(&ch->link);
+    wl_list_init(&ch->link);
   }
   free(c);
 }
@@ -428,6 +1026,9 @@ void on_xdg_new_surface(struct wl_listener *listener, void *data) {
     c->unmap.notify = on_xdg_surface_unmap;
     c->destroy.notify = on_xdg_surface_destroy;
     c->fullscreen.notify = on_xdg_surface_fullscreen;
+    c->new_subsurface.notify = on_client_new_subsurface;
+    c->new_popup.notify = on_client_new_popup;
+    wl_list_init(&c->children);
 
     wlr_xdg_toplevel_set_tiled(c->surface.xdg, WLR_EDGE_TOP | WLR_EDGE_BOTTOM |
                                                    WLR_EDGE_LEFT |
@@ -437,6 +1038,8 @@ void on_xdg_new_surface(struct wl_listener *listener, void *data) {
     wl_signal_add(&s->events.unmap, &c->unmap);
     wl_signal_add(&s->events.destroy, &c->destroy);
     wl_signal_add(&s->toplevel->events.request_fullscreen, &c->fullscreen);
+    wl_signal_add(&s->surface->events.new_subsurface, &c->new_subsurface);
+    wl_signal_add(&s->events.new_popup, &c->new_popup);
   }
 }
 
@@ -464,15 +1067,41 @@ void backward() {
   }
 }
 
-void sigchld(int unused) {
-  if (signal(SIGCHLD, sigchld) == SIG_ERR) {
-    log("%s", "can't install SIGCHLD handler");
+// Reap on the event loop, waitpid with WNOHANG never blocks. Xwayland's
+// server process is left alone, wlroots waits for it once it is ready.
+int on_sigchld(int sig, void *data) {
+  siginfo_t in;
+  while (!waitid(P_ALL, 0, &in, WEXITED | WNOHANG | WNOWAIT) && in.si_pid &&
+         (!xwayland || !xwayland->server ||
+          in.si_pid != xwayland->server->pid)) {
+    if (in.si_pid == bench_pid && !quit) {
+      log("bench: client exited early");
+      bench_failed = quit = 1;
+    }
+    waitpid(in.si_pid, NULL, 0);
   }
-  while (0 < waitpid(-1, NULL, WNOHANG))
-    ;
+  return 0;
+}
+
+// The scene never got mapped, or frames stopped coming
+int on_bench_timeout(void *data) {
+  log("bench: %s: timed out after %d frames", renderer_name(), bench_done);
+  if (bench_pid > 0) {
+    kill(bench_pid, SIGTERM);
+  }
+  bench_failed = quit = 1;
+  return 0;
 }
 
 void spawn(const char *cmd) {
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+  // Only the child gets DISPLAY, the compositor's environment is fixed once
+  // workers run, and with -x Xwayland appears later
+  if (xwayland) {
+    setenv("DISPLAY", xwayland->display_name, 1);
+  }
   setsid();
   execvp(cmd, (char *[]){NULL});
 }
@@ -552,40 +1181,64 @@ void on_input_destroy(struct wl_listener *listener, void *data) {
   //log("%s", "on_input_destroy");
   struct wlr_input_device *device = data;
   Input *input = device->data;
+  wl_list_remove(&input->destroy.link);
+  if (input->compiling) {
+    input->device = NULL;
+    return;
+  }
   wl_list_remove(&input->modifiers.link);
   wl_list_remove(&input->key.link);
-  wl_list_remove(&input->destroy.link);
   free(input);
 }
 
+void keymap_compile(void *data) {
+  Input *input = data;
+  input->keymap = xkb_map_new_from_names(input->context, &xkb_names,
+                                         XKB_KEYMAP_COMPILE_NO_FLAGS);
+  xkb_context_unref(input->context);
+  input->context = NULL;
+}
+
+// The keyboard only reaches the seat and bindings once it has a keymap
+void keymap_compiled(void *data) {
+  Input *input = data;
+  struct wlr_input_device *device = input->device;
+  input->compiling = 0;
+  if (!device) {
+    xkb_keymap_unref(input->keymap);
+    free(input);
+    return;
+  }
+
+  if (input->keymap) {
+    wlr_keyboard_set_keymap(device->keyboard, input->keymap);
+  }
+  xkb_keymap_unref(input->keymap);
+  input->keymap = NULL;
+
+  wl_signal_add(&device->keyboard->events.modifiers, &input->modifiers);
+  wl_signal_add(&device->keyboard->events.key, &input->key);
+  wlr_seat_set_keyboard(seat, device);
+}
+
 void on_backend_new_input(struct wl_listener *listener, void *data) {
   struct wlr_input_device *device = data;
   //log("on_backend_new_input: (%d): %s", device->type, device->name);
 
   if (device->type == WLR_INPUT_DEVICE_KEYBOARD) {
-    struct xkb_context *context;
-    struct xkb_keymap *keymap;
-
     Input *input = device->data = calloc(1, sizeof(*input));
     input->device = device;
+    input->compiling = 1;
+    input->context = xkb_context_new(XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+    submit(keymap_compile, keymap_compiled, input);
 
-    context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-    keymap = xkb_map_new_from_names(context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
-
-    wlr_keyboard_set_keymap(device->keyboard, keymap);
     wlr_keyboard_set_repeat_info(device->keyboard, 25, 350);
-    xkb_keymap_unref(keymap);
-    xkb_context_unref(context);
 
     input->key.notify = on_keyboard_key;
     input->destroy.notify = on_input_destroy;
     input->modifiers.notify = on_keyboard_modifiers;
 
-    wl_signal_add(&device->keyboard->events.modifiers, &input->modifiers);
-    wl_signal_add(&device->keyboard->events.key, &input->key);
     wl_signal_add(&device->events.destroy, &input->destroy);
-
-    wlr_seat_set_keyboard(seat, device);
   } else if (device->type == WLR_INPUT_DEVICE_POINTER) {
     wlr_cursor_attach_input_device(cursor, device);
   }
@@ -600,6 +1253,7 @@ void on_cursor_motion(struct wl_listener *listener, void *data) {
   Client *c = NULL;
 
   if ((c = xytoindependent(cursor->x, cursor->y))) {
+    pfocus = NULL;
     surface = wlr_surface_surface_at(
         c->surface.xwayland->surface, cursor->x - c->surface.xwayland->x,
         cursor->y - c->surface.xwayland->y, &sx, &sy);
@@ -612,19 +1266,23 @@ void on_cursor_motion(struct wl_listener *listener, void *data) {
   }
 
   if (!surface) {
+    pfocus = NULL;
     wlr_seat_pointer_notify_clear_focus(seat);
     return;
   }
 
   if (surface == seat->pointer_state.focused_surface) {
     wlr_seat_pointer_notify_motion(seat, e->time_msec, sx, sy);
+    if (pfocus && pfocus == c) {
+      focus_defer(c, e->time_msec);
+    }
     return;
   }
 
   wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
 
   if (c && c->type != X11Unmanaged) {
-    focus(c);
+    focus_defer(c, e->time_msec);
   }
 }
 
@@ -674,6 +1332,7 @@ void on_xwayland_new_surface(struct wl_listener *listener, void *data) {
   Client *c = calloc(1, sizeof(Client));
   c->surface.xwayland = xwayland_surface;
   c->type = xwayland_surface->override_redirect ? X11Unmanaged : X11Managed;
+  wl_list_init(&c->children);
   c->map.notify = on_xdg_surface_map;
   c->unmap.notify = on_xdg_surface_unmap;
   c->activate.notify = on_xwayland_surface_request_activate;
@@ -687,15 +1346,256 @@ void on_xwayland_new_surface(struct wl_listener *listener, void *data) {
   wl_signal_add(&xwayland_surface->events.destroy, &c->destroy);
 }
 
+void xwayland_connect(void *data) {
+  int *ok = data;
+  xcb_connection_t *xc = xcb_connect(xwayland->display_name, NULL);
+  *ok = !xcb_connection_has_error(xc);
+  xcb_disconnect(xc);
+}
+
+void xwayland_connected(void *data) {
+  int *ok = data;
+  if (*ok) {
+    wlr_xwayland_set_seat(xwayland, seat);
+    milestone(XwaylandReady);
+  }
+  free(ok);
+}
+
 void on_xwayland_ready(struct wl_listener *listener, void *data) {
   //log("%s", "on_xwayland_ready");
-  xcb_connection_t *xc = xcb_connect(xwayland->display_name, NULL);
-  if (xcb_connection_has_error(xc)) {
-    return;
+  submit(xwayland_connect, xwayland_connected, calloc(1, sizeof(int)));
+}
+
+void xwayland_start(int lazy) {
+  static struct wl_listener ready = {.notify = on_xwayland_ready};
+  static struct wl_listener new_surface = {.notify = on_xwayland_new_surface};
+
+  assert(xwayland = wlr_xwayland_create(display, compositor, lazy));
+  wl_signal_add(&xwayland->events.ready, &ready);
+  wl_signal_add(&xwayland->events.new_surface, &new_surface);
+}
+
+void stall_check(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  int64_t took = timespec_ns(&end) - timespec_ns(start);
+  if (took > stall_limit) {
+    stalls++;
   }
+  worst_stall = MAX(worst_stall, took);
+}
 
-  wlr_xwayland_set_seat(xwayland, seat);
-  xcb_disconnect(xc);
+// wl_display_run, timing each dispatch so callbacks that stall input and
+// frames show up in the stats. A dispatch runs every source that is ready,
+// so a slow one is attributed to its whole batch, not to one callback.
+void run() {
+  struct wl_event_loop *loop = wl_display_get_event_loop(display);
+  struct pollfd pfd = {.fd = wl_event_loop_get_fd(loop), .events = POLLIN};
+  struct timespec start;
+
+  while (!quit) {
+    // Idle sources queued outside a dispatch run before blocking, as
+    // wl_event_loop_dispatch would
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wl_event_loop_dispatch_idle(loop);
+    stall_check(&start);
+
+    wl_display_flush_clients(display);
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+      return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wl_event_loop_dispatch(loop, 0);
+    stall_check(&start);
+  }
+}
+
+// VmLck from /proc/self/status in KiB, or -1
+long locked_kib() {
+  long kib = -1;
+  char line[128];
+  FILE *f = fopen("/proc/self/status", "r");
+  if (!f) {
+    return kib;
+  }
+  while (fgets(line, sizeof line, f) && sscanf(line, "VmLck: %ld", &kib) != 1)
+    ;
+  fclose(f);
+  return kib;
+}
+
+// Realtime scheduling that spawned children do not inherit, and heap and
+// stack faulted in and locked before the first frame. Only what is mapped now
+// is locked: client shm pools mapped later must not be pinned or faulted in
+// on the event loop. Everything mapped includes libraries and GPU driver
+// mappings, so when RLIMIT_MEMLOCK is too small for that only the prefaulted
+// heap and stack are locked.
+void lowlatency_init() {
+  struct sched_param p = {.sched_priority = sched_get_priority_min(SCHED_RR)};
+  if (sched_setscheduler(0, SCHED_RR | SCHED_RESET_ON_FORK, &p) != 0) {
+    log("lowlatency: can't set SCHED_RR: %s", strerror(errno));
+  }
+
+  // The heap block comes from brk so that it stays in the heap once freed,
+  // later large allocations (pixman buffers) are mmapped and unmapped on free
+  // as usual. Up to twice its size of free heap is kept before trimming.
+  const size_t size = 8 << 20;
+  mallopt(M_MMAP_MAX, 0);
+  char *heap = malloc(size);
+  mallopt(M_MMAP_MAX, 65536);
+  mallopt(M_TRIM_THRESHOLD, 2 * size);
+  if (heap) {
+    memset(heap, 0, size);
+  }
+  volatile char stack[256 << 10];
+  for (size_t i = 0; i < sizeof stack; i += 4096) {
+    stack[i] = 0;
+  }
+
+  if (mlockall(MCL_CURRENT) != 0) {
+    log("lowlatency: can't lock all memory: %s", strerror(errno));
+    if ((heap && mlock(heap, size) != 0) ||
+        mlock((const void *)stack, sizeof stack) != 0) {
+      log("lowlatency: can't lock heap and stack: %s", strerror(errno));
+    }
+  }
+  free(heap);
+
+  struct rlimit limit;
+  getrlimit(RLIMIT_MEMLOCK, &limit);
+  if (limit.rlim_cur == RLIM_INFINITY) {
+    log("lowlatency: locked %ld KiB, no limit", locked_kib());
+  } else {
+    log("lowlatency: locked %ld KiB of a %lu KiB limit", locked_kib(),
+        (unsigned long)(limit.rlim_cur >> 10));
+  }
+}
+
+void bench_global(void *data, struct wl_registry *registry, uint32_t name,
+                  const char *interface, uint32_t version) {
+  if (strcmp(interface, wl_compositor_interface.name) == 0) {
+    bench_compositor =
+        wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+  } else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+    bench_subcompositor =
+        wl_registry_bind(registry, name, &wl_subcompositor_interface, 1);
+  } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+    bench_shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+  } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+    bench_wm = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+  }
+}
+
+void bench_global_remove(void *data, struct wl_registry *registry,
+                         uint32_t name) {}
+
+void bench_ping(void *data, struct xdg_wm_base *wm, uint32_t serial) {
+  xdg_wm_base_pong(wm, serial);
+}
+
+void bench_configure(void *data, struct xdg_surface *xdg, uint32_t serial) {
+  BenchSurface *s = data;
+  xdg_surface_ack_configure(xdg, serial);
+  wl_surface_attach(s->surface, s->buffer, 0, 0);
+  wl_surface_damage_buffer(s->surface, 0, 0, INT32_MAX, INT32_MAX);
+  wl_surface_commit(s->surface);
+}
+
+static const struct wl_registry_listener bench_registry = {
+    .global = bench_global,
+    .global_remove = bench_global_remove,
+};
+static const struct xdg_wm_base_listener bench_wm_listener = {
+    .ping = bench_ping,
+};
+static const struct xdg_surface_listener bench_xdg_surface = {
+    .configure = bench_configure,
+};
+
+// The benchmark scene: BenchTiles tiled toplevels with BenchSubsurfaces
+// subsurfaces each and one fullscreen toplevel, all backed by one shm pool
+void bench_client(const char *socket) {
+  struct wl_display *d = wl_display_connect(socket);
+  if (!d) {
+    _exit(EXIT_FAILURE);
+  }
+  wl_registry_add_listener(wl_display_get_registry(d), &bench_registry, NULL);
+  wl_display_roundtrip(d);
+  if (!bench_compositor || !bench_subcompositor || !bench_shm || !bench_wm) {
+    _exit(EXIT_FAILURE);
+  }
+  xdg_wm_base_add_listener(bench_wm, &bench_wm_listener, NULL);
+
+  char path[256];
+  snprintf(path, sizeof path, "%s/wm-bench-XXXXXX", getenv("XDG_RUNTIME_DIR"));
+  int fd = mkstemp(path);
+  size_t size = (size_t)mw * mh * 4;
+  if (fd < 0 || ftruncate(fd, size) != 0) {
+    _exit(EXIT_FAILURE);
+  }
+  unlink(path);
+
+  int tw = mw / 4, th = mh / 2, ss = BenchSubsurfaceSize;
+  struct wl_shm_pool *pool = wl_shm_create_pool(bench_shm, fd, size);
+  struct wl_buffer *full = wl_shm_pool_create_buffer(
+      pool, 0, mw, mh, mw * 4, WL_SHM_FORMAT_ARGB8888);
+  struct wl_buffer *tile = wl_shm_pool_create_buffer(
+      pool, 0, tw, th, tw * 4, WL_SHM_FORMAT_ARGB8888);
+  struct wl_buffer *sub = wl_shm_pool_create_buffer(pool, 0, ss, ss, ss * 4,
+                                                    WL_SHM_FORMAT_ARGB8888);
+
+  BenchSurface s[BenchTiles + 1];
+  struct xdg_toplevel *toplevel = NULL;
+  for (int i = 0; i <= BenchTiles; i++) {
+    s[i].surface = wl_compositor_create_surface(bench_compositor);
+    s[i].buffer = i == BenchTiles ? full : tile;
+    struct xdg_surface *xdg =
+        xdg_wm_base_get_xdg_surface(bench_wm, s[i].surface);
+    xdg_surface_add_listener(xdg, &bench_xdg_surface, &s[i]);
+    toplevel = xdg_surface_get_toplevel(xdg);
+    xdg_toplevel_set_app_id(toplevel, "bench");
+
+    for (int j = 0; i < BenchTiles && j < BenchSubsurfaces; j++) {
+      struct wl_surface *child = wl_compositor_create_surface(bench_compositor);
+      struct wl_subsurface *subsurface = wl_subcompositor_get_subsurface(
+          bench_subcompositor, child, s[i].surface);
+      wl_subsurface_set_position(subsurface, j * ss, 0);
+      wl_subsurface_set_desync(subsurface);
+      wl_surface_attach(child, sub, 0, 0);
+      wl_surface_damage_buffer(child, 0, 0, INT32_MAX, INT32_MAX);
+      wl_surface_commit(child);
+    }
+    wl_surface_commit(s[i].surface);
+  }
+
+  // Everything is mapped after the configures, then the last toplevel goes
+  // fullscreen over the tiles
+  wl_display_roundtrip(d);
+  xdg_toplevel_set_fullscreen(toplevel, NULL);
+  while (wl_display_dispatch(d) != -1)
+    ;
+  _exit(EXIT_SUCCESS);
+}
+
+// Benchmark each renderer in a child of its own. Returns 1 in the parent once
+// they have all finished, 0 in a child that should go on to run the benchmark.
+int bench_each_renderer() {
+  static const char *renderers[] = {"gles2", "pixman"};
+  for (size_t i = 0; i < LENGTH(renderers); i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      setenv("WLR_RENDERER", renderers[i], 1);
+      return 0;
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS) {
+      log("bench: %s: failed", renderers[i]);
+    }
+  }
+  return 1;
 }
 
 void handler(int sig) {
@@ -710,32 +1610,86 @@ void handler(int sig) {
 }
 
 int main(int argc, char *argv[]) {
+  milestone(Started);
   wlr_log_init(WLR_INFO, NULL);
   assert(getenv("XDG_RUNTIME_DIR"));
 
+  int opt;
+  while ((opt = getopt(argc, argv, "b:f:rR:x")) != -1) {
+    switch (opt) {
+    case 'f':
+      focus_delay = atoi(optarg);
+      break;
+    case 'r':
+      lowlatency = 1;
+      break;
+    case 'x':
+      prewarm = 1;
+      break;
+    case 'R':
+      setenv("WLR_RENDERER", optarg, 1);
+      break;
+    case 'b':
+      bench_frames = atoi(optarg);
+      break;
+    default:
+      panic("usage: %s [-f focus_delay_ms] [-r] [-x] [-R renderer] "
+            "[-b frames]",
+            argv[0]);
+    }
+  }
+
+  if (bench_frames > 0) {
+    setenv("WLR_BACKENDS", "headless", 1);
+    if (!getenv("WLR_RENDERER") && bench_each_renderer()) {
+      return EXIT_SUCCESS;
+    }
+  }
+
   signal(SIGSEGV, handler);
-  sigchld(0);
 
   wl_list_init(&clients);
   wl_list_init(&independents);
 
-  struct wl_display *display = wl_display_create();
+  display = wl_display_create();
+  const char *socket = wl_display_add_socket_auto(display);
+  assert(socket);
+  setenv("WAYLAND_DISPLAY", socket, 1);
+
+  xkb_names = (struct xkb_rule_names){
+      .rules = getenv("XKB_DEFAULT_RULES"),
+      .model = getenv("XKB_DEFAULT_MODEL"),
+      .layout = getenv("XKB_DEFAULT_LAYOUT"),
+      .variant = getenv("XKB_DEFAULT_VARIANT"),
+      .options = getenv("XKB_DEFAULT_OPTIONS"),
+  };
+
+  struct wl_event_loop *loop = wl_display_get_event_loop(display);
+  focus_timer = wl_event_loop_add_timer(loop, on_focus_timer, NULL);
+  stats_timer = wl_event_loop_add_timer(loop, on_stats_timer, NULL);
+  wl_event_source_timer_update(stats_timer, 1000);
+  wl_event_loop_add_signal(loop, SIGCHLD, on_sigchld, NULL);
+  wl_event_loop_add_signal(loop, SIGRTMIN + 1, on_profile, NULL);
+  wl_event_loop_add_signal(loop, SIGRTMIN + 2, on_profile, NULL);
+  workers_init(loop, 2);
+
   struct wlr_backend *backend = wlr_backend_autocreate(display);
   assert(backend);
 
   renderer = wlr_backend_get_renderer(backend);
+  assert(renderer);
+  log("renderer: %s", renderer_name());
   assert(wlr_renderer_init_wl_display(renderer, display));
-  struct wlr_compositor *compositor = wlr_compositor_create(display, renderer);
-  cm = wlr_xcursor_manager_create(NULL, 36);
+  compositor = wlr_compositor_create(display, renderer);
   xdg_shell = wlr_xdg_shell_create(display);
   cursor = wlr_cursor_create();
   ol = wlr_output_layout_create();
   seat = wlr_seat_create(display, "seat0");
-  assert(xwayland = wlr_xwayland_create(display, compositor, 1));
 
   wlr_seat_set_capabilities(seat, WL_SEAT_CAPABILITY_POINTER |
                                       WL_SEAT_CAPABILITY_KEYBOARD);
-  wlr_xcursor_manager_set_cursor_image(cm, "left_ptr", cursor);
+  submit(cursor_theme_load, cursor_theme_loaded,
+         wlr_xcursor_manager_create(NULL, 36));
 	wlr_cursor_attach_output_layout(cursor, ol);
   wlr_export_dmabuf_manager_v1_create(display);
   wlr_data_control_manager_v1_create(display);
@@ -765,27 +1719,38 @@ int main(int argc, char *argv[]) {
   wl_signal_add(
       &seat->events.request_set_primary_selection,
       &(struct wl_listener){.notify = on_seat_request_set_primary_selection});
-  wl_signal_add(&xwayland->events.ready,
-                &(struct wl_listener){.notify = on_xwayland_ready});
-  wl_signal_add(&xwayland->events.new_surface,
-                &(struct wl_listener){.notify = on_xwayland_new_surface});
-
-  const char *socket = wl_display_add_socket_auto(display);
-  assert(socket);
 
-  setenv("DISPLAY", xwayland->display_name, 1);
-  setenv("WAYLAND_DISPLAY", socket, 1);
+  if (!prewarm) {
+    xwayland_start(1);
+  }
 
   assert(wlr_backend_start(backend));
+  milestone(BackendStarted);
+
+  if (lowlatency) {
+    lowlatency_init();
+  }
 
-  wl_display_run(display);
+  if (bench_frames > 0) {
+    if ((bench_pid = fork()) == 0) {
+      bench_client(socket);
+    }
+    wl_event_source_timer_update(
+        wl_event_loop_add_timer(loop, on_bench_timeout, NULL),
+        10000 + 100 * MIN(bench_frames, 100000));
+    bench_failed = quit = bench_pid < 0;
+  }
 
-  wlr_xwayland_destroy(xwayland);
+  run();
+
+  if (xwayland) {
+    wlr_xwayland_destroy(xwayland);
+  }
   wl_display_destroy_clients(display);
   wlr_backend_destroy(backend);
   wlr_cursor_destroy(cursor);
   wlr_output_layout_destroy(ol);
   wlr_seat_destroy(seat);
   wl_display_destroy(display);
-  return EXIT_SUCCESS;
+  return bench_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
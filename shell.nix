@@ -2,16 +2,20 @@
 with pkgs;
 let
   enableXWayland = true;
-  version = "5e19e0053a5800252a27ce127fd015d641ee2e9e";
 
-  wlroots-git = wlroots.overrideAttrs (old: {
+  # See default.nix for why 0.14
+  version = "0.14.1";
+
+  wlroots-0_14 = wlroots.overrideAttrs (old: {
     version = version;
-    src = fetchFromGitHub {
-      owner = "swaywm";
+    src = fetchFromGitLab {
+      domain = "gitlab.freedesktop.org";
+      owner = "wlroots";
       repo = "wlroots";
       rev = version;
-      sha256 = "1ljrv8glahf5x32z5lab6xf6ngc3c3ji7mix2sgrzz5pk008fnx1";
+      sha256 = "1sshp3lvlkl1i670kxhwsb4xzxl8raz6769kqvgmxzcb63ns9ay1";
     };
+    patches = [ ];
     buildInputs = old.buildInputs ++ [ 
       libuuid 
       xorg.xcbutilrenderutil
@@ -22,12 +26,13 @@ in pkgs.mkShell {
   nativeBuildInputs = [ pkg-config ];
   buildInputs = [
     libGL
+    libdrm
     libinput
     libxkbcommon
     pixman
     wayland
     wayland-protocols
-    wlroots-git
+    wlroots-0_14
     x11
   ];
 }